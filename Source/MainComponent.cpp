@@ -6,14 +6,38 @@ MainComponent::MainComponent()
 {
     oscillator = new Oscillator();
 
+    // Golden-ratio spaced start phases, squeezed into +-1/8 cycle around the first
+    // voice. The voices are decorrelated, but never far enough apart to cancel
+    // each other at note-on (which spreading them over a whole cycle would do).
+    // The voices therefore add up almost in phase at note-on, so each voice count
+    // is normalised by that in-phase sum rather than by sqrt(voices).
+    double inPhaseSumRe = 0;
+    double inPhaseSumIm = 0;
+
+    for (int k = 0; k < MAX_UNISON_VOICES; k++)
+    {
+        auto offset = (std::fmod(k * 0.6180339887498949 + 0.5, 1.0) - 0.5) * 0.25;
+        unisonStartPhase[k] = (juce::uint32)(juce::int32)(offset * 4294967296.0);
+
+        // peak of the summed sines is the magnitude of the summed phasors
+        inPhaseSumRe += std::cos(offset * juce::MathConstants<double>::twoPi);
+        inPhaseSumIm += std::sin(offset * juce::MathConstants<double>::twoPi);
+        unisonNormaliseTable[k] = (float)(1.0 / std::hypot(inPhaseSumRe, inPhaseSumIm));
+    }
+
     // add callback of all midi devices
     deviceManager.addMidiInputDeviceCallback("", this);
 
-    // enable all midi devices
-    auto midiInputs = juce::MidiInput::getAvailableDevices();
-    for (auto input : midiInputs) {
-        deviceManager.setMidiInputDeviceEnabled(input.identifier, true);
-    }
+    // Opening every midi device can be slow on machines with many ports, so it's
+    // deferred until the window and the audio device are up, and redone whenever
+    // a device is plugged in or removed.
+    midiDeviceListConnection = juce::MidiDeviceListConnection::make([this] { updateMidiInputDevices(); });
+
+    juce::MessageManager::callAsync([safeThis = juce::Component::SafePointer<MainComponent>(this)]
+        {
+            if (safeThis != nullptr)
+                safeThis->updateMidiInputDevices();
+        });
 
     //==========================================================================
     // gain Slider
@@ -44,6 +68,46 @@ MainComponent::MainComponent()
     addAndMakeVisible(volumeSliderLabel);
     volumeSliderLabel.setText("volume", juce::dontSendNotification);
 
+    //==========================================================================
+    // unison voices Slider
+    addAndMakeVisible(unisonVoicesSlider);
+    unisonVoicesSlider.setRange(1, MAX_UNISON_VOICES, 1);
+    unisonVoicesSlider.onValueChange = [this]
+        {
+            unisonVoices.store((int)unisonVoicesSlider.getValue());
+        };
+    unisonVoicesSlider.setValue(unisonVoices.load());
+
+    addAndMakeVisible(unisonVoicesSliderLabel);
+    unisonVoicesSliderLabel.setText("unison", juce::dontSendNotification);
+
+    //==========================================================================
+    // unison detune Slider
+    addAndMakeVisible(unisonDetuneSlider);
+    unisonDetuneSlider.setRange(0, 100);
+    unisonDetuneSlider.setSkewFactorFromMidPoint(20);
+    unisonDetuneSlider.onValueChange = [this]
+        {
+            unisonDetune.store((float)unisonDetuneSlider.getValue());
+        };
+    unisonDetuneSlider.setValue(unisonDetune.load());
+
+    addAndMakeVisible(unisonDetuneSliderLabel);
+    unisonDetuneSliderLabel.setText("detune", juce::dontSendNotification);
+
+    //==========================================================================
+    // unison stereo spread Slider
+    addAndMakeVisible(unisonSpreadSlider);
+    unisonSpreadSlider.setRange(0, 1);
+    unisonSpreadSlider.onValueChange = [this]
+        {
+            unisonSpread.store((float)unisonSpreadSlider.getValue());
+        };
+    unisonSpreadSlider.setValue(unisonSpread.load());
+
+    addAndMakeVisible(unisonSpreadSliderLabel);
+    unisonSpreadSliderLabel.setText("spread", juce::dontSendNotification);
+
     //==========================================================================
     // Make sure you set the size of the component after
     // you add any child components.
@@ -65,6 +129,9 @@ MainComponent::MainComponent()
 
 MainComponent::~MainComponent()
 {
+    // stop listening for midi device changes before anything is torn down
+    midiDeviceListConnection = {};
+
     // This shuts down the audio device and clears the audio source.
     shutdownAudio();
 }
@@ -90,11 +157,71 @@ void MainComponent::prepareToPlay (int samplesPerBlockExpected, double sampleRat
     for (int i = 0; i < NUM_OF_MIDI_NOTES; i++)
     {
         auto frequency = 440 * std::pow(2, (i - A4NoteNumber) / 12.0);
-        auto cyclesPerSample = frequency / sampleRate;
-        midiNoteAngleDeltaTable[i] = cyclesPerSample * juce::MathConstants<double>::twoPi;
+        midiNoteCyclesPerSampleTable[i] = frequency / sampleRate;
+    }
+
+    updateUnisonTables(juce::jlimit(1, MAX_UNISON_VOICES, unisonVoices.load()), unisonDetune.load(), unisonSpread.load());
+
+    // nothing is playing yet, so there is nothing to ramp from
+    for (int k = 0; k < MAX_UNISON_VOICES; k++)
+    {
+        currentUnisonLeftGain[k] = unisonLeftGain[k];
+        currentUnisonRightGain[k] = unisonRightGain[k];
     }
 }
 
+void MainComponent::updateUnisonTables(int voices, float detune, float spread)
+{
+    // Called from prepareToPlay, and from the audio thread when one of the unison settings has changed.
+    // The settings are passed in already loaded, so the tables match the values that were checked.
+
+    // A note starts at the same level whatever the number of voices. As detuned
+    // voices drift apart it gets quieter, by up to about 1 / sqrt(voices).
+    const float normalise = unisonNormaliseTable[voices - 1];
+
+    double detuneRatio[MAX_UNISON_VOICES];
+
+    // unused voices fade out to zero
+    for (int k = voices; k < MAX_UNISON_VOICES; k++)
+    {
+        unisonLeftGain[k] = 0;
+        unisonRightGain[k] = 0;
+    }
+
+    for (int k = 0; k < voices; k++)
+    {
+        // -1 (lowest / leftmost voice) ~ +1 (highest / rightmost voice)
+        auto position = voices > 1 ? 2.0f * k / (voices - 1) - 1.0f : 0.0f;
+
+        detuneRatio[k] = std::pow(2.0, detune * position / 1200.0);
+
+        // constant power pan, the centre position gives 1 on both sides
+        auto panAngle = (spread * position + 1.0f) * juce::MathConstants<float>::pi / 4.0f;
+        unisonLeftGain[k] = std::cos(panAngle) * juce::MathConstants<float>::sqrt2 * normalise;
+        unisonRightGain[k] = std::sin(panAngle) * juce::MathConstants<float>::sqrt2 * normalise;
+    }
+
+    for (int i = 0; i < NUM_OF_MIDI_NOTES; i++)
+    {
+        // voices added while a note is sounding start relative to the first voice
+        for (int k = preparedUnisonVoices; k < voices; k++)
+        {
+            midiNotePhase[i][k] = midiNotePhase[i][0] + unisonStartPhase[k];
+        }
+
+        for (int k = 0; k < voices; k++)
+        {
+            // anything above nyquist would only alias, and must not overflow the phase
+            auto cyclesPerSample = juce::jlimit(0.0, 0.5, midiNoteCyclesPerSampleTable[i] * detuneRatio[k]);
+            midiNotePhaseDeltaTable[i][k] = (juce::uint32)(cyclesPerSample * 4294967296.0);
+        }
+    }
+
+    preparedUnisonVoices = voices;
+    preparedUnisonDetune = detune;
+    preparedUnisonSpread = spread;
+}
+
 void MainComponent::getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill)
 {
     // Your audio-processing code goes here!
@@ -105,68 +232,174 @@ void MainComponent::getNextAudioBlock (const juce::AudioSourceChannelInfo& buffe
     // (to prevent the output of random noise)
     //bufferToFill.clearActiveBufferRegion();
 
+    // load each unison setting once per block
+    const int newUnisonVoices = juce::jlimit(1, MAX_UNISON_VOICES, unisonVoices.load());
+    const float newUnisonDetune = unisonDetune.load();
+    const float newUnisonSpread = unisonSpread.load();
+
+    if (newUnisonVoices != preparedUnisonVoices
+        || newUnisonDetune != preparedUnisonDetune
+        || newUnisonSpread != preparedUnisonSpread)
+    {
+        updateUnisonTables(newUnisonVoices, newUnisonDetune, newUnisonSpread);
+    }
+
+    // A change of the unison settings ramps the gain of each voice over the block,
+    // so added voices fade in and removed voices fade out instead of clicking.
+    float leftGainStep[MAX_UNISON_VOICES];
+    float rightGainStep[MAX_UNISON_VOICES];
+    bool isGainRamping[MAX_UNISON_VOICES];
+    int renderedVoices = 0;
+
+    for (int k = 0; k < MAX_UNISON_VOICES; k++)
+    {
+        leftGainStep[k] = (unisonLeftGain[k] - currentUnisonLeftGain[k]) / juce::jmax(1, bufferToFill.numSamples);
+        rightGainStep[k] = (unisonRightGain[k] - currentUnisonRightGain[k]) / juce::jmax(1, bufferToFill.numSamples);
+        isGainRamping[k] = leftGainStep[k] != 0 || rightGainStep[k] != 0;
+
+        if (isGainRamping[k] || unisonLeftGain[k] != 0 || unisonRightGain[k] != 0)
+            renderedVoices = k + 1;
+    }
+
+    using FVO = juce::FloatVectorOperations;
+
     auto* leftBuffer = bufferToFill.buffer->getWritePointer(0, bufferToFill.startSample);
     auto* rightBuffer = bufferToFill.buffer->getWritePointer(1, bufferToFill.startSample);
 
-    for (auto sample = 0; sample < bufferToFill.numSamples; ++sample)
+    FVO::clear(leftBuffer, bufferToFill.numSamples);
+    FVO::clear(rightBuffer, bufferToFill.numSamples);
+
+    // Each note is rendered a chunk of samples at a time, one unison voice after
+    // another, so that the oscillator and mixing run on whole vectors of samples.
+    for (int chunkStart = 0; chunkStart < bufferToFill.numSamples; chunkStart += MAX_OSCILLATOR_BLOCK_SIZE)
     {
-        float currentSample = 0.0f;
+        const int chunkSize = juce::jmin(MAX_OSCILLATOR_BLOCK_SIZE, bufferToFill.numSamples - chunkStart);
+
+        for (int k = 0; k < renderedVoices; k++)
+        {
+            if (isGainRamping[k])
+            {
+                for (int sample = 0; sample < chunkSize; sample++)
+                {
+                    unisonLeftGainRamp[k][sample] = currentUnisonLeftGain[k] + leftGainStep[k] * (chunkStart + sample + 1);
+                    unisonRightGainRamp[k][sample] = currentUnisonRightGain[k] + rightGainStep[k] * (chunkStart + sample + 1);
+                }
+            }
+        }
 
         for (int i = 0; i < NUM_OF_MIDI_NOTES; i++)
         {
-            if (midiNoteState[i] == NoteState::On) {
+            bool isSounding = false;
+            bool isSilentAtEnd = false;
+
+            for (int sample = 0; sample < chunkSize; sample++)
+            {
+                float envelope;
+
+                if (midiNoteState[i] == NoteState::On) {
+
+                    if (midiNoteTimer[i] < attackSamples) {
+                        envelope = previousVolume[i] + (float)midiNoteTimer[i] / attackSamples * (1 - previousVolume[i]);
+                    }
+                    else if (midiNoteTimer[i] < attackSamples + holdSamples) {
+                        envelope = 1;
+                    }
+                    else if (midiNoteTimer[i] < attackSamples + holdSamples + decaySamples) {
+                        envelope = 1 + (float)(sustainVolume - 1) / decaySamples * (midiNoteTimer[i] - attackSamples - holdSamples);
+                    }
+                    else {
+                        envelope = sustainVolume;
+                    }
 
-                if (midiNoteTimer[i] < attackSamples) {
-                    currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i] * (previousVolume[i] + (float)midiNoteTimer[i] / attackSamples * (1 - previousVolume[i]));
                 }
-                else if (midiNoteTimer[i] < attackSamples + holdSamples) {
-                    currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i];
+                else if (midiNoteState[i] == NoteState::Off && midiNoteTimer[i] < releaseSamples) {
+
+                    previousVolume[i] = sustainVolume * (1 - (float)midiNoteTimer[i] / releaseSamples);
+                    envelope = previousVolume[i];
+
                 }
-                else if (midiNoteTimer[i] < attackSamples + holdSamples + decaySamples) {
-                    currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i] * (1 + (float)(sustainVolume - 1) / decaySamples * (midiNoteTimer[i] - attackSamples - holdSamples));
+                else if (midiNoteState[i] == NoteState::Pedal && midiNoteTimer[i] < pedalSamples) {
+
+                    previousVolume[i] = sustainVolume * (1 - sqrtf((float)midiNoteTimer[i] / pedalSamples));
+                    envelope = previousVolume[i];
+
+                }
+                else if (midiNoteState[i] == NoteState::PedalOff && midiNoteTimer[i] < releaseSamples && previousVolume[i] != 0) {
+
+                    previousVolume[i] = sustainVolume * (1 - sqrtf((float)pedalOffTime[i] / pedalSamples)) * (1 - (float)midiNoteTimer[i] / releaseSamples);
+                    envelope = previousVolume[i];
+
                 }
                 else {
-                    currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i] * sustainVolume;
+
+                    previousVolume[i] = 0;
+                    envelopeChunk[sample] = 0;
+                    isSilentAtEnd = true;
+
+                    midiNoteTimer[i]++;
+                    continue;
+
                 }
 
-                midiNoteCurrentAngle[i] += midiNoteAngleDeltaTable[i];
+                envelopeChunk[sample] = midiNoteVelocity[i] * envelope;
+                isSilentAtEnd = false;
+
+                // a chunk that is entirely at zero amplitude isn't worth rendering
+                if (envelopeChunk[sample] != 0) {
+                    isSounding = true;
+                }
 
+                midiNoteTimer[i]++;
             }
-            else if (midiNoteState[i] == NoteState::Off && midiNoteTimer[i] < releaseSamples) {
 
-                previousVolume[i] = sustainVolume * (1 - (float)midiNoteTimer[i] / releaseSamples);
-                currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i] * previousVolume[i];
-                midiNoteCurrentAngle[i] += midiNoteAngleDeltaTable[i];
+            if (isSounding) {
 
-            }
-            else if (midiNoteState[i] == NoteState::Pedal && midiNoteTimer[i] < pedalSamples) {
+                midiNoteIdle[i] = false;
 
-                previousVolume[i] = sustainVolume * (1 - sqrtf((float)midiNoteTimer[i] / pedalSamples));
-                currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i] * previousVolume[i];
-                midiNoteCurrentAngle[i] += midiNoteAngleDeltaTable[i];
+                for (int k = 0; k < renderedVoices; k++) {
 
-            }
-            else if (midiNoteState[i] == NoteState::PedalOff && midiNoteTimer[i] < releaseSamples && previousVolume[i] != 0) {
+                    auto phase = midiNotePhase[i][k];
+                    auto phaseDelta = midiNotePhaseDeltaTable[i][k];
 
-                previousVolume[i] = sustainVolume * (1 - sqrtf((float)pedalOffTime[i] / pedalSamples)) * (1 - (float)midiNoteTimer[i] / releaseSamples);
-                currentSample += oscillator->currentOscillator(midiNoteCurrentAngle[i]) * midiNoteVelocity[i] * previousVolume[i];
-                midiNoteCurrentAngle[i] += midiNoteAngleDeltaTable[i];
+                    for (int sample = 0; sample < chunkSize; sample++) {
+                        phaseChunk[sample] = phase + (juce::uint32)sample * phaseDelta;
+                    }
+                    midiNotePhase[i][k] = phase + (juce::uint32)chunkSize * phaseDelta;
 
-            }
-            else {
+                    oscillator->renderBlock(phaseChunk, voiceChunk, chunkSize);
+                    FVO::multiply(voiceChunk, envelopeChunk, chunkSize);
 
-                previousVolume[i] = 0;
-                midiNoteCurrentAngle[i] = 0;
+                    if (isGainRamping[k]) {
+                        FVO::addWithMultiply(leftBuffer + chunkStart, voiceChunk, unisonLeftGainRamp[k], chunkSize);
+                        FVO::addWithMultiply(rightBuffer + chunkStart, voiceChunk, unisonRightGainRamp[k], chunkSize);
+                    }
+                    else {
+                        FVO::addWithMultiply(leftBuffer + chunkStart, voiceChunk, currentUnisonLeftGain[k], chunkSize);
+                        FVO::addWithMultiply(rightBuffer + chunkStart, voiceChunk, currentUnisonRightGain[k], chunkSize);
+                    }
+
+                }
 
             }
 
-            midiNoteTimer[i]++;
+            // reset the phases once, when the note has just become silent
+            if (isSilentAtEnd && ! midiNoteIdle[i]) {
+                for (int k = 0; k < MAX_UNISON_VOICES; k++) {
+                    midiNotePhase[i][k] = unisonStartPhase[k];
+                }
+                midiNoteIdle[i] = true;
+            }
         }
+    }
 
-        leftBuffer[sample] = currentSample * volume;
-        rightBuffer[sample] = currentSample * volume;
-
+    for (int k = 0; k < MAX_UNISON_VOICES; k++)
+    {
+        currentUnisonLeftGain[k] = unisonLeftGain[k];
+        currentUnisonRightGain[k] = unisonRightGain[k];
     }
+
+    FVO::multiply(leftBuffer, volume, bufferToFill.numSamples);
+    FVO::multiply(rightBuffer, volume, bufferToFill.numSamples);
 }
 
 void MainComponent::releaseResources()
@@ -201,6 +434,15 @@ void MainComponent::resized()
     gainSliderLabel.setBounds(labelArea.removeFromTop(40));
     gainSlider.setBounds(area.removeFromTop(40));
 
+    unisonVoicesSliderLabel.setBounds(labelArea.removeFromTop(40));
+    unisonVoicesSlider.setBounds(area.removeFromTop(40));
+
+    unisonDetuneSliderLabel.setBounds(labelArea.removeFromTop(40));
+    unisonDetuneSlider.setBounds(area.removeFromTop(40));
+
+    unisonSpreadSliderLabel.setBounds(labelArea.removeFromTop(40));
+    unisonSpreadSlider.setBounds(area.removeFromTop(40));
+
 }
 
 void MainComponent::handleIncomingMidiMessage(juce::MidiInput* source, const juce::MidiMessage& message)
@@ -250,4 +492,50 @@ void MainComponent::handleIncomingMidiMessage(juce::MidiInput* source, const juc
 
     juce::Logger::getCurrentLogger()->writeToLog(noteInfo);
 
+}
+
+void MainComponent::updateMidiInputDevices()
+{
+    // Called on the message thread. Only the midi inputs are opened / closed here,
+    // so the audio device keeps running without interruption.
+
+    auto midiInputs = juce::MidiInput::getAvailableDevices();
+
+    // disable devices that have been removed
+    for (auto input : enabledMidiInputs) {
+        if (! midiInputs.contains(input)) {
+            deviceManager.setMidiInputDeviceEnabled(input.identifier, false);
+            juce::Logger::getCurrentLogger()->writeToLog("MIDI device removed: " + input.name);
+        }
+    }
+
+    // forget failed devices once they are unplugged, so they are retried when plugged in again
+    failedMidiInputs.removeIf([&midiInputs](const juce::MidiDeviceInfo& input) { return ! midiInputs.contains(input); });
+
+    juce::Array<juce::MidiDeviceInfo> openedMidiInputs;
+
+    // enable devices that have been plugged in
+    for (auto input : midiInputs) {
+        if (deviceManager.isMidiInputDeviceEnabled(input.identifier)) {
+            openedMidiInputs.add(input);
+            continue;
+        }
+
+        if (failedMidiInputs.contains(input)) {
+            continue;
+        }
+
+        deviceManager.setMidiInputDeviceEnabled(input.identifier, true);
+
+        if (deviceManager.isMidiInputDeviceEnabled(input.identifier)) {
+            openedMidiInputs.add(input);
+            juce::Logger::getCurrentLogger()->writeToLog("MIDI device added: " + input.name);
+        }
+        else {
+            failedMidiInputs.add(input);
+            juce::Logger::getCurrentLogger()->writeToLog("MIDI device failed to open: " + input.name);
+        }
+    }
+
+    enabledMidiInputs = openedMidiInputs;
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 // range of note number is 0 ~ 127
 #define NUM_OF_MIDI_NOTES 128
 
+// maximum number of detuned oscillators stacked on one note
+#define MAX_UNISON_VOICES 8
+
 //==============================================================================
 /*
     This component lives inside our window, and this is where you should put all
@@ -31,6 +34,8 @@ public:
 
 private:
     void handleIncomingMidiMessage(juce::MidiInput* source, const juce::MidiMessage& message) override;
+    void updateUnisonTables(int voices, float detune, float spread);
+    void updateMidiInputDevices();
 
     //==============================================================================
     // Your private member variables go here...
@@ -41,9 +46,27 @@ private:
     juce::Slider gainSlider;
     juce::Label  gainSliderLabel;
 
+    juce::Slider unisonVoicesSlider;
+    juce::Label  unisonVoicesSliderLabel;
+
+    juce::Slider unisonDetuneSlider;
+    juce::Label  unisonDetuneSliderLabel;
+
+    juce::Slider unisonSpreadSlider;
+    juce::Label  unisonSpreadSliderLabel;
+
     juce::AudioDeviceManager deviceManager;
     juce::String currentDeviceId;
 
+    // midi inputs enabled by updateMidiInputDevices()
+    juce::Array<juce::MidiDeviceInfo> enabledMidiInputs;
+
+    // midi inputs that failed to open, not retried until they are unplugged
+    juce::Array<juce::MidiDeviceInfo> failedMidiInputs;
+
+    // notifies us on the message thread when a midi device is plugged in or removed
+    juce::MidiDeviceListConnection midiDeviceListConnection;
+
     Oscillator* oscillator;
 
     float gain = 1;
@@ -56,11 +79,57 @@ private:
 
     int midiNoteTimer[NUM_OF_MIDI_NOTES] = {};
 
-    // radians
-    double midiNoteCurrentAngle[NUM_OF_MIDI_NOTES] = {};
+    // 32-bit fixed-point phase, one full cycle = 2^32 (wraps around naturally)
+    juce::uint32 midiNotePhase[NUM_OF_MIDI_NOTES][MAX_UNISON_VOICES] = {};
+
+    // phase increment per sample for each unison voice
+    juce::uint32 midiNotePhaseDeltaTable[NUM_OF_MIDI_NOTES][MAX_UNISON_VOICES] = {};
+
+    // cycles per sample without detune
+    double midiNoteCyclesPerSampleTable[NUM_OF_MIDI_NOTES] = {};
+
+    // phase each unison voice starts from when a note starts, built in the constructor
+    juce::uint32 unisonStartPhase[MAX_UNISON_VOICES] = {};
+
+    // gain for (index + 1) voices, so that their in-phase sum at note-on is 1
+    float unisonNormaliseTable[MAX_UNISON_VOICES] = {};
+
+    // true once a silent note has had its phases reset
+    bool midiNoteIdle[NUM_OF_MIDI_NOTES] = {};
+
+    // scratch buffers for one chunk of getNextAudioBlock()
+    float envelopeChunk[MAX_OSCILLATOR_BLOCK_SIZE] = {};
+    float voiceChunk[MAX_OSCILLATOR_BLOCK_SIZE] = {};
+    juce::uint32 phaseChunk[MAX_OSCILLATOR_BLOCK_SIZE] = {};
+
+    // gain each unison voice is heading for, 0 for unused voices
+    float unisonLeftGain[MAX_UNISON_VOICES] = {};
+
+    float unisonRightGain[MAX_UNISON_VOICES] = {};
+
+    // gain each unison voice had at the end of the last block
+    float currentUnisonLeftGain[MAX_UNISON_VOICES] = {};
+
+    float currentUnisonRightGain[MAX_UNISON_VOICES] = {};
+
+    // per-sample gains of the unison voices while they ramp, for one chunk
+    float unisonLeftGainRamp[MAX_UNISON_VOICES][MAX_OSCILLATOR_BLOCK_SIZE] = {};
+
+    float unisonRightGainRamp[MAX_UNISON_VOICES][MAX_OSCILLATOR_BLOCK_SIZE] = {};
+
+    // written by the sliders on the message thread, read by the audio thread
+    std::atomic<int> unisonVoices { 1 };
+
+    // cents, the outermost voices are detuned by +-unisonDetune
+    std::atomic<float> unisonDetune { 10.0f };
+
+    // 0 = mono, 1 = outermost voices hard left / right
+    std::atomic<float> unisonSpread { 0.5f };
 
-    // radians per sample
-    double midiNoteAngleDeltaTable[NUM_OF_MIDI_NOTES] = {};
+    // values the tables above were last built with
+    int preparedUnisonVoices = 0;
+    float preparedUnisonDetune = -1;
+    float preparedUnisonSpread = -1;
 
     bool isPedal = false;
 
@@ -1,25 +1,37 @@
 #include "Oscillator.h"
 
-float Oscillator::sinOscillator(float radians) {
-	return (float)std::sin(radians);
-}
+// Renders one sample for each phase (32-bit fixed point, one full cycle = 2^32).
+// Everything is done with FloatVectorOperations, so it runs on SIMD whatever the compiler.
+void Oscillator::renderBlock(const juce::uint32* phases, float* output, int numSamples) {
+	jassert(numSamples <= MAX_OSCILLATOR_BLOCK_SIZE);
 
-float Oscillator::distortionOscillator(float radians) {
-	auto sin = gain * std::sin(radians);
-	if (sin > 1) return 1;
-	else if (sin < -1) return -1;
-	else return sin;
-}
+	using FVO = juce::FloatVectorOperations;
+
+	const float halfPi = juce::MathConstants<float>::halfPi;
+
+	// taylor series of sin up to x^11, highest order first
+	static const float coefficients[] = { -1.0f / 39916800.0f, 1.0f / 362880.0f, -1.0f / 5040.0f, 1.0f / 120.0f, -1.0f / 6.0f, 1.0f };
+
+	// read as signed, the phase maps to -pi ~ pi
+	FVO::convertFixedToFloat(radians, reinterpret_cast<const int*>(phases), juce::MathConstants<float>::twoPi / 4294967296.0f, numSamples);
+
+	// sin is symmetric around +-pi/2, so fold onto -pi/2 ~ pi/2: x = 2 * clip(x) - x
+	FVO::clip(output, radians, -halfPi, halfPi, numSamples);
+	FVO::multiply(output, 2.0f, numSamples);
+	FVO::subtract(radians, output, radians, numSamples);
+
+	// error is around 2e-7 (float rounding) for x <= pi/2
+	FVO::multiply(radiansSquared, radians, radians, numSamples);
+	FVO::fill(output, coefficients[0], numSamples);
+	for (int n = 1; n < juce::numElementsInArray(coefficients); n++) {
+		FVO::multiply(output, radiansSquared, numSamples);
+		FVO::add(output, coefficients[n], numSamples);
+	}
+	FVO::multiply(output, radians, numSamples);
 
-float Oscillator::currentOscillator(float radians) {
-	switch (num)
-	{
-	case Oscillator::sin:
-		return sinOscillator(radians);
-	case Oscillator::distortion:
-		return distortionOscillator(radians);
-	default:
-		break;
+	if (num == distortion) {
+		FVO::multiply(output, gain, numSamples);
+		FVO::clip(output, output, -1.0f, 1.0f, numSamples);
 	}
 }
 
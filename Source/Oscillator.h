@@ -1,12 +1,13 @@
 #pragma once
 #include <JuceHeader.h>
 
+// maximum number of samples renderBlock() handles in one call
+#define MAX_OSCILLATOR_BLOCK_SIZE 256
+
 class Oscillator
 {
 public:
-	float sinOscillator(float radians);
-	float distortionOscillator(float radians);
-	float currentOscillator(float radians);
+	void renderBlock(const juce::uint32* phases, float* output, int numSamples);
 	enum oscillatorNumber {
 		sin,
 		distortion
@@ -17,4 +18,8 @@ public:
 private:
 	oscillatorNumber num = distortion;
 	float gain = 1;
+
+	// scratch buffers for renderBlock()
+	float radians[MAX_OSCILLATOR_BLOCK_SIZE] = {};
+	float radiansSquared[MAX_OSCILLATOR_BLOCK_SIZE] = {};
 };
\ No newline at end of file